@@ -0,0 +1,413 @@
+//  SuperTux Launcher - A simple launcher interface for SuperTux
+//  Copyright (C) 2021 Semphris <semphris@protonmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdio.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "curl/curl.h"
+#include "SDL.h"
+#include "SDL_image.h"
+#include "SDL_ttf.h"
+
+#include "ui/listbox.hpp"
+#include "util/log.hpp"
+#include "video/sdl/sdl_window.hpp"
+#include "video/font.hpp"
+#include "video/window.hpp"
+
+#include "http_server.hpp"
+#include "launcher.hpp"
+
+#define INSTALLS_CATEGORIES 100
+#define INSTALLS_VERSIONS 100         // per category
+#define INSTALLS_RUNS 20
+#define DOWNLOAD_SIZE 67108864        // bytes
+#define DOWNLOAD_RUNS 5
+#define THROTTLED_SIZE 8388608        // bytes
+#define THROTTLED_SPEED 4194304       // bytes per second
+#define UPLOAD_SIZE 8388608           // bytes
+#define UPLOAD_RUNS 5
+#define RANK_LATENCY 200              // ms added by the slower mirror
+#define ERROR_EVERY 3                 // requests; the third is the download
+#define FRAME_ITEMS 200               // versions in the main menu list
+#define FRAME_WARMUP 10
+#define FRAME_RUNS 500
+
+// Git revision of the benchmarked code, set by CMake
+#ifndef STLAUNCHER_REVISION
+#define STLAUNCHER_REVISION "unknown"
+#endif
+
+static std::ostream* output = &std::cout;
+static std::vector<std::string> filters;
+// Set when a run fails, so that the benchmarks exit with an error
+static bool failed = false;
+
+bool
+selected(const std::string& name)
+{
+  if (filters.empty())
+    return true;
+
+  for (const auto& filter : filters)
+  {
+    if (name.compare(0, filter.size(), filter) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+// Prints one line of JSON per benchmark, so that results can be collected and
+// compared across commits.
+void
+report(const std::string& name, const std::string& unit, std::vector<double> samples)
+{
+  if (samples.empty())
+    return;
+
+  std::sort(samples.begin(), samples.end());
+  double sum = 0.0;
+  for (double sample : samples)
+  {
+    sum += sample;
+  }
+
+  size_t n = samples.size();
+  *output << "{\"time\":" << std::time(nullptr) << ",\"revision\":\"" << STLAUNCHER_REVISION
+          << "\",\"benchmark\":\"" << name << "\",\"unit\":\"" << unit
+          << "\",\"samples\":" << n << ",\"min\":" << samples.front()
+          << ",\"median\":" << samples[n / 2] << ",\"mean\":" << sum / n
+          << ",\"p99\":" << samples[std::min(n - 1, n * 99 / 100)]
+          << ",\"max\":" << samples.back() << "}" << std::endl;
+}
+
+// Runs the function the given number of times and returns how long each run
+// took, in seconds. Runs for which the function returns false have failed and
+// are left out.
+std::vector<double>
+time_runs(int runs, const std::function<bool()>& func)
+{
+  std::vector<double> times;
+  for (int i = 0; i < runs; i++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = func();
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    if (ok)
+      times.push_back(time.count());
+    else
+      failed = true;
+  }
+
+  return times;
+}
+
+std::vector<double>
+per_second(double amount, std::vector<double> times)
+{
+  for (auto& time : times)
+  {
+    time = amount / time;
+  }
+
+  return times;
+}
+
+void
+bench_installs(const std::string& dir)
+{
+  std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>> installs;
+  for (int c = 0; c < INSTALLS_CATEGORIES; c++)
+  {
+    std::vector<std::tuple<std::string, std::string>> versions;
+    for (int v = 0; v < INSTALLS_VERSIONS; v++)
+    {
+      std::string version = "0." + std::to_string(c) + "." + std::to_string(v);
+      versions.push_back(std::make_tuple("v" + version, "https://example.org/download/supertux-" + version + ".AppImage"));
+    }
+    installs.push_back(std::make_tuple("Category " + std::to_string(c), versions));
+  }
+
+  std::string file = dir + "/installs.txt";
+
+  if (selected("save_installs"))
+  {
+    report("save_installs", "s", time_runs(INSTALLS_RUNS, [&file, &installs] {
+      save(file, installs);
+      return true;
+    }));
+  }
+
+  if (selected("get_installs"))
+  {
+    save(file, installs);
+    size_t count = 0;
+    report("get_installs", "s", time_runs(INSTALLS_RUNS, [&file, &count] {
+      count += get_installs(file.c_str()).size();
+      return true;
+    }));
+
+    // get_installs() always adds the "Custom" category
+    if (count != size_t(INSTALLS_RUNS) * (INSTALLS_CATEGORIES + 1))
+      log_warn << "get_installs read " << count << " categories" << std::endl;
+  }
+
+  remove(file.c_str());
+}
+
+void
+bench_network(const std::string& dir)
+{
+  std::string body(DOWNLOAD_SIZE, '\0');
+  for (size_t i = 0; i < body.size(); i++)
+  {
+    body[i] = char(i * 31 + i / 4096);
+  }
+
+  std::string file = dir + "/download.bin";
+  auto download = [&file](const std::string& url) {
+    auto r = fetch_file(url, file.c_str(), false);
+    if (!r.empty())
+      log_warn << "Download from '" << url << "' failed: " << r << std::endl;
+
+    return r.empty();
+  };
+
+  // Not timed; fails the benchmarks if the mirror answering first isn't ranked
+  // first.
+  if (selected("rank_mirrors"))
+  {
+    HTTPServer::Options slow_options;
+    slow_options.latency = RANK_LATENCY;
+    HTTPServer slow(body, slow_options);
+    HTTPServer fast(body, HTTPServer::Options());
+
+    auto ranked = rank_mirrors({ slow.get_url("download.bin"), fast.get_url("download.bin") });
+    if (ranked.empty() || ranked.front() != fast.get_url("download.bin"))
+    {
+      log_warn << "rank_mirrors() put the slower mirror first" << std::endl;
+      failed = true;
+    }
+  }
+
+  if (selected("download"))
+  {
+    HTTPServer server(body, HTTPServer::Options());
+    report("download", "bytes/s", per_second(DOWNLOAD_SIZE, time_runs(DOWNLOAD_RUNS, [&server, &download] {
+      return download(server.get_url("download.bin"));
+    })));
+  }
+
+  // Simulates a slow connection; shows how close downloads get to the link's
+  // capacity.
+  if (selected("download_throttled"))
+  {
+    HTTPServer::Options options;
+    options.latency = 50;
+    options.throttle = THROTTLED_SPEED;
+    HTTPServer server(body.substr(0, THROTTLED_SIZE), options);
+    report("download_throttled", "bytes/s", per_second(THROTTLED_SIZE, time_runs(1, [&server, &download] {
+      return download(server.get_url("download.bin"));
+    })));
+  }
+
+  // The fastest mirror drops the connection halfway through; measures the
+  // cost of resuming on the other one. New servers are started on each run,
+  // as the launcher remembers failed mirrors; only the download is timed.
+  if (selected("download_failover"))
+  {
+    HTTPServer::Options dropping;
+    dropping.drop_after = DOWNLOAD_SIZE / 2;
+    HTTPServer::Options backup;
+    backup.latency = 100;
+
+    std::vector<double> times;
+    for (int i = 0; i < DOWNLOAD_RUNS; i++)
+    {
+      HTTPServer primary(body, dropping);
+      HTTPServer secondary(body, backup);
+      auto time = time_runs(1, [&primary, &secondary, &download] {
+        return download(primary.get_url("download.bin") + " " + secondary.get_url("download.bin"));
+      });
+      times.insert(times.end(), time.begin(), time.end());
+    }
+
+    report("download_failover", "bytes/s", per_second(DOWNLOAD_SIZE, times));
+  }
+
+  // The fastest mirror answers the probe and the size check, then refuses the
+  // download itself with a 503; measures the cost of falling back to the
+  // other one.
+  if (selected("download_error"))
+  {
+    HTTPServer::Options failing;
+    failing.fail_every = ERROR_EVERY;
+    HTTPServer::Options backup;
+    backup.latency = 100;
+
+    std::vector<double> times;
+    for (int i = 0; i < DOWNLOAD_RUNS; i++)
+    {
+      HTTPServer primary(body, failing);
+      HTTPServer secondary(body, backup);
+      auto time = time_runs(1, [&primary, &secondary, &download] {
+        return download(primary.get_url("download.bin") + " " + secondary.get_url("download.bin"));
+      });
+      times.insert(times.end(), time.begin(), time.end());
+    }
+
+    report("download_error", "bytes/s", per_second(DOWNLOAD_SIZE, times));
+  }
+
+  if (selected("upload"))
+  {
+    std::string log = dir + "/console.log";
+    std::ofstream(log, std::ios::out | std::ios::binary) << body.substr(0, UPLOAD_SIZE);
+
+    HTTPServer server("", HTTPServer::Options());
+    report("upload", "bytes/s", per_second(UPLOAD_SIZE, time_runs(UPLOAD_RUNS, [&server, &log] {
+      auto r = upload_crash(log.c_str(), server.get_url("upload_crash"));
+      if (!r.empty())
+        log_warn << "Upload failed: " << r << std::endl;
+
+      return r.empty();
+    })));
+
+    if (server.get_bytes_received() < size_t(UPLOAD_SIZE) * UPLOAD_RUNS)
+      log_warn << "Server received only " << server.get_bytes_received() << " bytes" << std::endl;
+
+    remove(log.c_str());
+  }
+
+  remove(file.c_str());
+}
+
+void
+bench_frames()
+{
+  if (!selected("frame_main_menu") && !selected("frame_download"))
+    return;
+
+  SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+  if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) || !IMG_Init(IMG_INIT_PNG) || TTF_Init())
+  {
+    log_warn << "Skipping frame benchmarks, could not init SDL: " << SDL_GetError() << std::endl;
+    return;
+  }
+
+  {
+    SDLWindow w(Size(640.f, 400.f), true);
+
+    Control::ThemeSet t, t2, t3;
+    make_themes(t, t2, t3);
+
+    Container c_always(false, 1, Rect(0, 0, 640, 400), t, nullptr);
+    Container c_mainmenu(false, 1, Rect(0, 0, 640, 400), t, nullptr);
+
+    auto& l = add_versions_list(c_mainmenu, t, t2);
+    for (int i = 0; i < FRAME_ITEMS; i++)
+    {
+      l.add_item("v0.0." + std::to_string(i), "/opt/supertux/" + std::to_string(i) + "/supertux2");
+    }
+
+    // Same menu as the launcher, with buttons that do nothing
+    MainMenuActions actions;
+    actions.play = actions.check_versions = actions.add = actions.detach =
+      actions.remove = actions.minimize = actions.quit = [](int) {};
+    add_main_menu_buttons(c_always, c_mainmenu, t, t3, actions);
+
+    // The first frames load the textures and fonts
+    auto main_menu = [&w, &c_always, &c_mainmenu] {
+      draw_frame(w, c_always, c_mainmenu);
+      c_always.update(0.015f);
+      c_mainmenu.update(0.015f);
+      return true;
+    };
+    time_runs(FRAME_WARMUP, main_menu);
+    time_runs(FRAME_WARMUP, [&w] { draw_download_screen(w); return true; });
+
+    if (selected("frame_main_menu"))
+      report("frame_main_menu", "s", time_runs(FRAME_RUNS, main_menu));
+
+    if (selected("frame_download"))
+      report("frame_download", "s", time_runs(FRAME_RUNS, [&w] { draw_download_screen(w); return true; }));
+  }
+
+  Font::flush_fonts();
+  TTF_Quit();
+  IMG_Quit();
+  SDL_Quit();
+}
+
+int
+main(int argc, char** argv)
+{
+  std::ofstream file;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if ((arg == "-o" || arg == "--output") && i + 1 < argc)
+    {
+      file.open(argv[++i], std::ios::out | std::ios::app);
+      output = &file;
+    }
+    else if (arg == "-h" || arg == "--help")
+    {
+      std::cout << "Usage: " << argv[0] << " [--output FILE] [BENCHMARK...]\n\n"
+                   "Runs the benchmarks whose names start with any of the given\n"
+                   "names, or all of them, and prints the results as JSON lines.\n"
+                   "Run from the build folder, so that ../data can be found.\n";
+      return 0;
+    }
+    else
+    {
+      filters.push_back(arg);
+    }
+  }
+
+  // Frames are rendered offscreen, unless asked otherwise
+  SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  char* pref = SDL_GetPrefPath("SuperTux", "stlauncher_bench");
+  std::string dir(pref ? pref : ".");
+  SDL_free(pref);
+
+  try
+  {
+    bench_installs(dir);
+    bench_network(dir);
+    bench_frames();
+  }
+  catch (std::exception& e)
+  {
+    log_fatal << "Unhandled exception: " << e.what() << std::endl;
+    curl_global_cleanup();
+    return 1;
+  }
+
+  curl_global_cleanup();
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,216 @@
+//  SuperTux Launcher - A simple launcher interface for SuperTux
+//  Copyright (C) 2021 Semphris <semphris@protonmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "http_server.hpp"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+HTTPServer::HTTPServer(const std::string& body, const Options& options) :
+  m_body(body),
+  m_options(options),
+  m_socket(socket(AF_INET, SOCK_STREAM, 0)),
+  m_port(0),
+  m_quit(false),
+  m_requests(0),
+  m_bytes_received(0),
+  m_thread(),
+  m_connections(),
+  m_connections_mutex()
+{
+  if (m_socket == -1)
+    throw std::runtime_error("Could not create server socket");
+
+  int yes = 1;
+  setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t len = sizeof(addr);
+  if (bind(m_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))
+      || listen(m_socket, 16)
+      || getsockname(m_socket, reinterpret_cast<sockaddr*>(&addr), &len))
+  {
+    close(m_socket);
+    throw std::runtime_error("Could not start local HTTP server");
+  }
+
+  m_port = ntohs(addr.sin_port);
+  m_thread = std::thread(&HTTPServer::run, this);
+}
+
+HTTPServer::~HTTPServer()
+{
+  m_quit = true;
+  m_thread.join();
+
+  std::lock_guard<std::mutex> lock(m_connections_mutex);
+  for (auto& connection : m_connections)
+  {
+    connection.join();
+  }
+
+  close(m_socket);
+}
+
+std::string
+HTTPServer::get_url(const std::string& file) const
+{
+  return "http://127.0.0.1:" + std::to_string(m_port) + "/" + file;
+}
+
+void
+HTTPServer::run()
+{
+  while (!m_quit)
+  {
+    pollfd pfd = { m_socket, POLLIN, 0 };
+    if (poll(&pfd, 1, 50) <= 0)
+      continue;
+
+    int fd = accept(m_socket, nullptr, nullptr);
+    if (fd == -1)
+      continue;
+
+    std::lock_guard<std::mutex> lock(m_connections_mutex);
+    m_connections.emplace_back(&HTTPServer::handle, this, fd);
+  }
+}
+
+void
+HTTPServer::handle(int fd)
+{
+  // Read the headers; whatever comes after is the start of the body.
+  std::string request;
+  char buf[16384];
+  while (request.find("\r\n\r\n") == std::string::npos)
+  {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0)
+    {
+      close(fd);
+      return;
+    }
+    request.append(buf, n);
+  }
+
+  auto headers_end = request.find("\r\n\r\n") + 4;
+  std::string method = request.substr(0, request.find(' '));
+  auto header = [&request, headers_end](const std::string& name) {
+    auto pos = request.find("\r\n" + name + ": ");
+    if (pos == std::string::npos || pos > headers_end)
+      return std::string();
+
+    pos += name.size() + 4;
+    return request.substr(pos, request.find("\r\n", pos) - pos);
+  };
+
+  if (method == "POST")
+  {
+    if (header("Expect") == "100-continue")
+    {
+      const std::string cont = "HTTP/1.1 100 Continue\r\n\r\n";
+      send(fd, cont.data(), cont.size(), MSG_NOSIGNAL);
+    }
+
+    size_t length = std::stoul("0" + header("Content-Length"));
+    size_t received = request.size() - headers_end;
+    while (received < length)
+    {
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0)
+        break;
+      received += n;
+    }
+    m_bytes_received += received;
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(m_options.latency));
+
+  std::string status = "200 OK";
+  size_t start = 0, end = m_body.size();
+  std::string extra_headers;
+
+  std::string range = header("Range");
+  if (!range.empty() && range.compare(0, 6, "bytes=") == 0)
+  {
+    start = std::stoul(range.substr(6));
+    auto dash = range.find('-');
+    if (dash + 1 < range.size())
+      end = std::min(end, std::stoul(range.substr(dash + 1)) + 1);
+
+    status = "206 Partial Content";
+    extra_headers = "Content-Range: bytes " + std::to_string(start) + "-"
+                    + std::to_string(end - 1) + "/" + std::to_string(m_body.size())
+                    + "\r\n";
+  }
+
+  if (start >= end && method != "POST")
+  {
+    status = "416 Range Not Satisfiable";
+    start = end = 0;
+    extra_headers.clear();
+  }
+
+  if (m_options.fail_every && ++m_requests % m_options.fail_every == 0)
+  {
+    status = "503 Service Unavailable";
+    start = end = 0;
+    extra_headers.clear();
+  }
+
+  if (method == "POST")
+    start = end = 0;
+
+  std::string response = "HTTP/1.1 " + status + "\r\nContent-Length: "
+                         + std::to_string(end - start) + "\r\n"
+                         + extra_headers + "Connection: close\r\n\r\n";
+  send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+
+  if (method != "HEAD")
+  {
+    auto begin = std::chrono::steady_clock::now();
+    size_t sent = 0;
+    while (start + sent < end && !m_quit)
+    {
+      if (m_options.drop_after && sent >= m_options.drop_after)
+        break;
+
+      size_t chunk = std::min<size_t>(end - start - sent, 16384);
+      if (m_options.drop_after)
+        chunk = std::min(chunk, m_options.drop_after - sent);
+
+      ssize_t n = send(fd, m_body.data() + start + sent, chunk, MSG_NOSIGNAL);
+      if (n <= 0)
+        break;
+      sent += n;
+
+      if (m_options.throttle)
+      {
+        std::this_thread::sleep_until(begin + std::chrono::microseconds(sent * 1000000 / m_options.throttle));
+      }
+    }
+  }
+
+  close(fd);
+}
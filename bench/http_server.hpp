@@ -0,0 +1,76 @@
+//  SuperTux Launcher - A simple launcher interface for SuperTux
+//  Copyright (C) 2021 Semphris <semphris@protonmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HEADER_STLAUNCHER_BENCH_HTTP_SERVER_HPP
+#define HEADER_STLAUNCHER_BENCH_HTTP_SERVER_HPP
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Minimal HTTP/1.1 server on localhost, standing in for the download and crash
+ * report servers. Every GET or HEAD is answered with the same body, whatever
+ * the path; byte ranges are supported. POST bodies are read and discarded.
+ */
+class HTTPServer final
+{
+public:
+  struct Options
+  {
+    /** Delay before answering each request, in milliseconds */
+    int latency = 0;
+    /** Maximum bytes per second sent for each request; 0 for no limit */
+    size_t throttle = 0;
+    /** Close the connection after sending that many body bytes; 0 to never */
+    size_t drop_after = 0;
+    /** Answer every Nth request with an error; 0 to never */
+    int fail_every = 0;
+  };
+
+public:
+  HTTPServer(const std::string& body, const Options& options);
+  ~HTTPServer();
+
+  /** @return The URL of a file on this server */
+  std::string get_url(const std::string& file) const;
+  /** @return The total number of body bytes received through POST requests */
+  size_t get_bytes_received() const { return m_bytes_received; }
+
+private:
+  void run();
+  void handle(int fd);
+
+private:
+  const std::string m_body;
+  const Options m_options;
+  int m_socket;
+  int m_port;
+  std::atomic<bool> m_quit;
+  std::atomic<int> m_requests;
+  std::atomic<size_t> m_bytes_received;
+  std::thread m_thread;
+  std::vector<std::thread> m_connections;
+  std::mutex m_connections_mutex;
+
+private:
+  HTTPServer(const HTTPServer&) = delete;
+  HTTPServer& operator=(const HTTPServer&) = delete;
+};
+
+#endif
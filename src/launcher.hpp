@@ -0,0 +1,75 @@
+//  SuperTux Launcher - A simple launcher interface for SuperTux
+//  Copyright (C) 2021 Semphris <semphris@protonmail.com>
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HEADER_STLAUNCHER_LAUNCHER_HPP
+#define HEADER_STLAUNCHER_LAUNCHER_HPP
+
+#include <functional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "ui/listbox.hpp"
+#include "video/window.hpp"
+
+// Defined in main.cpp; also used by the benchmarks.
+
+std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>>
+get_installs(const char* path);
+void save(std::string path, const std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>>& installs);
+
+/**
+ * If `resume` is set, continues the partial file already at `path`.
+ * @return An error message, or an empty string on success
+ */
+std::string fetch_file(std::string url, const char* path, bool cacheable = false,
+                       bool resume = false);
+/** @return An error message, or an empty string on success */
+std::string upload_crash(const char* path, const std::string& urls);
+/** Sorts the mirrors of a file from fastest to slowest */
+std::vector<std::string> rank_mirrors(const std::vector<std::string>& mirrors);
+
+void draw_download_screen(Window& w);
+void draw_frame(Window& w, Container& c_always, Container& active);
+
+/** What the buttons of the main menu and of the title bar do when clicked */
+struct MainMenuActions
+{
+  std::function<void(int)> play;
+  std::function<void(int)> check_versions;
+  std::function<void(int)> add;
+  std::function<void(int)> detach;
+  std::function<void(int)> remove;
+  std::function<void(int)> minimize;
+  std::function<void(int)> quit;
+};
+
+/**
+ * Fills in the themes of the launcher: `t` for most controls, `t2` for the
+ * lists and `t3` for the title bar buttons.
+ */
+void make_themes(Control::ThemeSet& t, Control::ThemeSet& t2, Control::ThemeSet& t3);
+
+/** Adds the list of installed versions to the main menu, empty */
+Listbox<std::string>& add_versions_list(Container& c_mainmenu, const Control::ThemeSet& t,
+                                        const Control::ThemeSet& t2);
+
+/** Adds the buttons of the main menu, and those of the title bar to c_always */
+void add_main_menu_buttons(Container& c_always, Container& c_mainmenu,
+                           const Control::ThemeSet& t, const Control::ThemeSet& t3,
+                           const MainMenuActions& actions);
+
+#endif
@@ -18,14 +18,27 @@
 #define UNIX 1
 #endif
 
+#include <algorithm>
+#include <cmath>
+#include <ctime>
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <stdio.h>
 #ifdef UNIX
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
 #endif
 
 #include "curl/curl.h"
@@ -48,11 +61,29 @@
 #include "video/renderer.hpp"
 #include "video/window.hpp"
 
+#include "launcher.hpp"
+
 #define OS "x64-linux"
 
 #define CRASH_URL "https://supertux.semphris.com/upload_crash"
 #define VERSIONS_URL "http://supertux.semphris.com/versions/" OS
 
+#define PREFETCH_DELAY 10000          // ms after startup before prefetching
+#define PREFETCH_RETRY_DELAY 60000    // ms between two failed attempts
+#define PREFETCH_MAX_SPEED 262144     // bytes per second, 0 for no limit
+
+#define CACHE_MAX_SIZE 4294967296LL   // bytes
+#define CACHE_TMP_MAX_AGE 86400       // seconds before removing stray temp files
+
+#define MIRROR_PROBE_SIZE 16384       // bytes read from each mirror to rank it
+#define MIRROR_PROBE_RANGE "0-16383"
+#define MIRROR_PROBE_TIMEOUT 5000     // ms
+#define MIRROR_RANK_TTL 600           // seconds before probing a mirror again
+#define MIRROR_STALL_SPEED 1024       // bytes per second under which, for...
+#define MIRROR_STALL_TIME 15          // ...that many seconds, switch mirrors
+
+#define METRICS_MAX_SIZE 1048576      // bytes before rotating the JSONL file
+
 void
 create_dir(const char* path)
 {
@@ -66,8 +97,46 @@ create_dir(const char* path)
 #endif
 }
 
+// Several mirrors of the same file can be given by separating them with
+// spaces; the first one is the canonical URL of the file. The list may also
+// hold the checksum of the file, as "sha256:" followed by the hex digest.
+std::vector<std::string>
+split_mirrors(const std::string& urls)
+{
+  std::vector<std::string> mirrors;
+  std::istringstream in(urls);
+  std::string url;
+  while (in >> url)
+  {
+    if (url.compare(0, 7, "sha256:"))
+      mirrors.push_back(url);
+  }
+
+  return mirrors;
+}
+
+// Returns the lowercase SHA-256 digest given in a list of mirrors, if any.
+std::string
+artifact_sha256(const std::string& urls)
+{
+  std::istringstream in(urls);
+  std::string token;
+  while (in >> token)
+  {
+    if (token.compare(0, 7, "sha256:") || token.size() != 7 + 64)
+      continue;
+
+    std::string digest = token.substr(7);
+    std::transform(digest.begin(), digest.end(), digest.begin(), ::tolower);
+    if (digest.find_first_not_of("0123456789abcdef") == std::string::npos)
+      return digest;
+  }
+
+  return "";
+}
+
 std::string
-upload_crash(const char* path)
+upload_crash(const char* path, const std::string& urls)
 {
   std::string contents;
   std::ifstream in(path, std::ios::in | std::ios::binary);
@@ -81,7 +150,7 @@ upload_crash(const char* path)
   in.close();
 
   CURL *curl;
-  CURLcode res;
+  CURLcode res = CURLE_FAILED_INIT;
 
   struct curl_httppost *formpost = NULL;
   struct curl_httppost *lastptr = NULL;
@@ -90,8 +159,6 @@ upload_crash(const char* path)
 
   FILE *devnull = fopen("/dev/null", "w+");
 
-  curl_global_init(CURL_GLOBAL_ALL);
-
   curl_formadd(&formpost, &lastptr, CURLFORM_COPYNAME, "cache-control:",
                CURLFORM_COPYCONTENTS, "no-cache", CURLFORM_END);
   curl_formadd(&formpost, &lastptr, CURLFORM_COPYNAME, "content-type:",
@@ -99,180 +166,1473 @@ upload_crash(const char* path)
   curl_formadd(&formpost, &lastptr, CURLFORM_COPYNAME, "logs", CURLFORM_BUFFER,
                "data", CURLFORM_BUFFERPTR, contents.data(),
                CURLFORM_BUFFERLENGTH, contents.size(), CURLFORM_END);
-  curl = curl_easy_init();
 
   headerlist = curl_slist_append(headerlist, buf);
-  if (curl) {
-    curl_easy_setopt(curl, CURLOPT_URL, CRASH_URL);
+  for (const auto& url : split_mirrors(urls))
+  {
+    curl = curl_easy_init();
+    if (!curl)
+      break;
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_HTTPPOST, formpost);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, devnull);
     res = curl_easy_perform(curl);
     curl_easy_cleanup(curl);
-    curl_formfree(formpost);
-    curl_slist_free_all(headerlist);
+
+    if (res == CURLE_OK)
+      break;
+
+    log_warn << "Could not upload crash to '" << url << "': "
+             << curl_easy_strerror(res) << std::endl;
+  }
+
+  curl_formfree(formpost);
+  curl_slist_free_all(headerlist);
+  fclose(devnull);
+
+  return (res == CURLE_OK) ? "" : curl_easy_strerror(res);
+}
+
+static size_t donwload_size_so_far = 0;
+static double donwload_size_total = 0;
+static Window* window_to_draw_on = nullptr;
+
+// Number of reasons for the background prefetch to stay quiet (foreground
+// downloads, running game...). The prefetch only runs while this is zero.
+static SDL_atomic_t prefetch_paused;
+static SDL_atomic_t prefetch_quit;
+// Set while the prefetch works on a file in the staging folder
+static SDL_atomic_t prefetch_busy;
+static SDL_Thread* prefetch_thread = nullptr;
+
+struct PrefetchPause
+{
+  PrefetchPause() { SDL_AtomicAdd(&prefetch_paused, 1); }
+  ~PrefetchPause() { SDL_AtomicAdd(&prefetch_paused, -1); }
+};
+
+struct PrefetchBusy
+{
+  PrefetchBusy() { SDL_AtomicSet(&prefetch_busy, 1); }
+  ~PrefetchBusy() { SDL_AtomicSet(&prefetch_busy, 0); }
+};
+
+// Metrics are appended to a JSONL file and/or kept in a Prometheus textfile.
+// Both are empty if disabled, in which case recording does nothing.
+static std::string metrics_jsonl;
+static std::string metrics_prometheus;
+static long long metrics_max_size = METRICS_MAX_SIZE;
+static std::vector<std::string> metrics_disabled;
+// Prometheus series, with their value and whether they are counters
+static std::map<std::string, std::tuple<double, bool>> metrics_series;
+// Measures are kept in memory until flush_metrics() writes them out
+static std::string metrics_pending;
+static bool metrics_changed = false;
+static std::mutex metrics_mutex;
+
+std::string
+escape_metric_label(const std::string& label)
+{
+  std::string escaped;
+  for (char c : label)
+  {
+    if (c == '\\' || c == '"')
+      escaped += '\\';
+
+    if (c == '\n')
+      escaped += "\\n";
+    else
+      escaped += c;
+  }
+
+  return escaped;
+}
+
+// Rewrites the whole textfile; it is renamed into place so that exporters
+// never read a partial file.
+void
+write_prometheus()
+{
+  std::string tmp = metrics_prometheus + ".tmp";
+  std::ofstream out(tmp);
+  out.precision(15);
+
+  std::string last_name;
+  for (const auto& series : metrics_series)
+  {
+    std::string name = series.first.substr(0, series.first.find('{'));
+    if (name != last_name)
+    {
+      out << "# TYPE " << name << (std::get<1>(series.second) ? " counter\n" : " gauge\n");
+      last_name = name;
+    }
+
+    out << series.first << " " << std::get<0>(series.second) << "\n";
+  }
+
+  out.close();
+  if (out.fail() || rename(tmp.c_str(), metrics_prometheus.c_str()))
+  {
+    log_warn << "Could not write metrics to '" << metrics_prometheus << "'" << std::endl;
+    remove(tmp.c_str());
+  }
+}
+
+// Writes the measures recorded since the last call, once per transfer or
+// launch rather than once per measure.
+void
+flush_metrics()
+{
+  std::lock_guard<std::mutex> lock(metrics_mutex);
+
+  if (!metrics_jsonl.empty() && !metrics_pending.empty())
+  {
+    std::ifstream in(metrics_jsonl, std::ios::in | std::ios::ate);
+    if (in && in.tellg() > metrics_max_size)
+    {
+      in.close();
+      rename(metrics_jsonl.c_str(), (metrics_jsonl + ".1").c_str());
+    }
+
+    std::ofstream out(metrics_jsonl, std::ios::out | std::ios::app);
+    out << metrics_pending;
+    if (out.fail())
+      log_warn << "Could not write metrics to '" << metrics_jsonl << "'" << std::endl;
+  }
+  metrics_pending.clear();
+
+  if (!metrics_prometheus.empty() && metrics_changed)
+    write_prometheus();
+  metrics_changed = false;
+}
+
+void
+add_metric(const std::string& name, double value, const std::string& label_name,
+           const std::string& label, bool counter)
+{
+  if (metrics_jsonl.empty() && metrics_prometheus.empty())
+    return;
+
+  if (std::find(metrics_disabled.begin(), metrics_disabled.end(), name) != metrics_disabled.end())
+    return;
+
+  std::lock_guard<std::mutex> lock(metrics_mutex);
+
+  if (!metrics_jsonl.empty())
+  {
+    std::ostringstream line;
+    line.precision(15);
+    line << "{\"time\":" << std::time(nullptr) << ",\"metric\":\"" << name << "\"";
+    if (!label_name.empty())
+      line << ",\"" << label_name << "\":\"" << escape_metric_label(label) << "\"";
+
+    line << ",\"value\":" << value << "}\n";
+    metrics_pending += line.str();
+  }
+
+  if (!metrics_prometheus.empty())
+  {
+    std::string series = "stlauncher_" + name;
+    if (!label_name.empty())
+      series += "{" + label_name + "=\"" + escape_metric_label(label) + "\"}";
+
+    auto& entry = metrics_series[series];
+    entry = std::make_tuple(counter ? std::get<0>(entry) + value : value, counter);
+    metrics_changed = true;
+  }
+}
+
+void
+record_metric(const std::string& name, double value,
+              const std::string& label_name = "", const std::string& label = "")
+{
+  add_metric(name, value, label_name, label, false);
+}
+
+void
+count_metric(const std::string& name, const std::string& label_name = "",
+             const std::string& label = "")
+{
+  add_metric(name, 1.0, label_name, label, true);
+}
+
+// Turns the result of system() into the exit code of the program, or 128 plus
+// the signal number if it was killed, like shells do.
+int
+exit_code(int status)
+{
+#ifdef UNIX
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+
+  return WEXITSTATUS(status);
+#else
+  return status;
+#endif
+}
+
+// Machine-wide download cache, shared by all the users of the machine. Empty
+// if disabled.
+static std::string cache_path;
+static long long cache_max_size = CACHE_MAX_SIZE;
+
+// Stops early and returns false if given a function that returns false.
+bool
+copy_file(const std::string& from, const std::string& to, bool (*proceed)() = nullptr)
+{
+  std::ifstream in(from, std::ios::in | std::ios::binary);
+  if (!in)
+    return false;
+
+  std::ofstream out(to, std::ios::out | std::ios::binary | std::ios::trunc);
+  std::vector<char> buf(65536);
+  while (in.read(buf.data(), buf.size()) || in.gcount() > 0)
+  {
+    if (proceed && !proceed())
+      return false;
+
+    out.write(buf.data(), in.gcount());
+  }
+  out.close();
+
+  return !in.bad() && !out.fail();
+}
+
+void
+sha256_block(uint32_t state[8], const unsigned char block[64])
+{
+  static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+  auto rotr = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++)
+  {
+    w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16)
+           | (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+  }
+  for (int i = 16; i < 64; i++)
+  {
+    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+           e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; i++)
+  {
+    uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25))
+                  + ((e & f) ^ (~e & g)) + k[i] + w[i];
+    uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22))
+                  + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+// Returns the lowercase hex SHA-256 digest of the file, or an empty string if
+// it can't be read.
+std::string
+sha256_file(const std::string& path)
+{
+  std::ifstream in(path, std::ios::in | std::ios::binary);
+  if (!in)
+    return "";
+
+  uint32_t state[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  unsigned long long length = 0;
+  unsigned char block[64];
+  size_t n = 0;
+
+  std::vector<char> buf(65536);
+  while (in.read(buf.data(), buf.size()) || in.gcount() > 0)
+  {
+    for (std::streamsize i = 0; i < in.gcount(); i++)
+    {
+      block[n++] = buf[i];
+      if (n == 64)
+      {
+        sha256_block(state, block);
+        n = 0;
+      }
+    }
+    length += in.gcount();
+  }
+
+  if (in.bad())
+    return "";
+
+  block[n++] = 0x80;
+  if (n > 56)
+  {
+    memset(block + n, 0, 64 - n);
+    sha256_block(state, block);
+    n = 0;
+  }
+  memset(block + n, 0, 56 - n);
+  for (int i = 0; i < 8; i++)
+  {
+    block[56 + i] = (unsigned char) ((length * 8) >> (56 - i * 8));
+  }
+  sha256_block(state, block);
+
+  char hex[65];
+  for (int i = 0; i < 8; i++)
+  {
+    snprintf(hex + i * 8, 9, "%08x", state[i]);
+  }
+
+  return hex;
+}
+
+#ifdef UNIX
+// Readers hold a shared lock while copying out of the cache; eviction holds
+// an exclusive one. Writers don't need it, as entries appear atomically.
+// flock() doesn't need write access, so the lock file is opened read-only and
+// works whoever created it.
+int
+cache_lock(int operation)
+{
+  int fd = open((cache_path + "/.lock").c_str(), O_RDONLY | O_CREAT, 0666);
+  if (fd != -1)
+    fchmod(fd, 0666);  // Undo the umask; fails harmlessly if not the owner
+
+  if (fd != -1 && flock(fd, operation))
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+void
+cache_unlock(int fd)
+{
+  if (fd != -1)
+  {
+    flock(fd, LOCK_UN);
+    close(fd);
+  }
+}
+
+// Removes the least recently used entries until the cache fits in its size.
+void
+cache_evict()
+{
+  int lock = cache_lock(LOCK_EX);
+  if (lock == -1)
+    return;
+
+  DIR* dir = opendir(cache_path.c_str());
+  if (!dir)
+  {
+    cache_unlock(lock);
+    return;
+  }
+
+  std::vector<std::tuple<time_t, long long, std::string>> entries;
+  long long total = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)))
+  {
+    std::string name = entry->d_name;
+    std::string file = cache_path + "/" + name;
+    struct stat st;
+    if (name.at(0) == '.' || stat(file.c_str(), &st) || !S_ISREG(st.st_mode))
+      continue;
+
+    // Leftovers from writers which didn't get to rename their file
+    if (name.size() > 4 && name.substr(name.size() - 4) == ".tmp")
+    {
+      if (time(nullptr) - st.st_mtime > CACHE_TMP_MAX_AGE)
+        unlink(file.c_str());
+
+      continue;
+    }
+
+    entries.push_back(std::make_tuple(st.st_mtime, (long long) st.st_size, file));
+    total += st.st_size;
+  }
+  closedir(dir);
+
+  std::sort(entries.begin(), entries.end());
+  for (const auto& e : entries)
+  {
+    if (total <= cache_max_size)
+      break;
+
+    if (!unlink(std::get<2>(e).c_str()))
+      total -= std::get<1>(e);
+  }
+
+  cache_unlock(lock);
+}
+#endif
+
+// Copies the cached file with the given SHA-256 digest to the given path, if
+// any. Entries are named after their digest; since any member of the group
+// can write to the cache, the copy is checked against it before being used.
+bool
+cache_fetch(const std::string& sha256, const std::string& path, bool (*proceed)() = nullptr)
+{
+#ifdef UNIX
+  if (cache_path.empty() || sha256.empty())
+    return false;
+
+  // Leave the destination alone on a miss; it may be a partial download
+  std::string entry = cache_path + "/" + sha256;
+  if (!std::ifstream(entry).good())
+    return false;
+
+  int lock = cache_lock(LOCK_SH);
+  bool found = copy_file(entry, path, proceed);
+  cache_unlock(lock);
+
+  if (!found)
+  {
+    remove(path.c_str());
+    return false;
+  }
+
+  if (sha256_file(path) != sha256)
+  {
+    log_warn << "Cache entry '" << entry << "' does not match its checksum; "
+             << "ignoring it" << std::endl;
+    remove(path.c_str());
+    unlink(entry.c_str());
+    return false;
+  }
+
+  // Mark as recently used; may fail on entries from other users, in which
+  // case they age from the time they were added.
+  utime(entry.c_str(), nullptr);
+  log_info << "Copied '" << entry << "' from cache" << std::endl;
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Adds a downloaded file, already checked against the given SHA-256 digest, to
+// the cache. Entries are written to a temporary file first, then renamed so
+// that other users never see a partial file.
+void
+cache_store(const std::string& sha256, const std::string& path)
+{
+#ifdef UNIX
+  if (cache_path.empty() || sha256.empty())
+    return;
+
+  std::string entry = cache_path + "/" + sha256;
+  std::string tmp = entry + "." + std::to_string(getpid()) + ".tmp";
+  if (!copy_file(path, tmp))
+  {
+    log_warn << "Could not add '" << path << "' to cache" << std::endl;
+    remove(tmp.c_str());
+    return;
+  }
+
+  chmod(tmp.c_str(), 0664);
+  if (rename(tmp.c_str(), entry.c_str()))
+  {
+    remove(tmp.c_str());
+    return;
+  }
+
+  cache_evict();
+#endif
+}
+
+size_t
+dont_write(void*, size_t size, size_t nmemb, void*) {
+  return size * nmemb;
+}
+
+// Time taken by each mirror host to answer a probe, and when it was probed.
+// Shared with the prefetch thread.
+static std::map<std::string, std::tuple<double, std::time_t>> mirror_scores;
+static std::mutex mirror_scores_mutex;
+// The scores are kept in the pref folder, as the launcher is rarely open for
+// long; empty if they aren't saved.
+static std::string mirror_scores_path;
+
+std::string
+mirror_host(const std::string& url)
+{
+  auto start = url.find("://");
+  return url.substr(0, url.find('/', (start == std::string::npos) ? 0 : start + 3));
+}
+
+// Mirrors that ignore the range would send the whole file; stop reading once
+// enough was received, which counts as a successful probe.
+size_t
+probe_write(void*, size_t size, size_t nmemb, size_t* received) {
+  *received += size * nmemb;
+  return (*received > MIRROR_PROBE_SIZE) ? 0 : size * nmemb;
+}
+
+// Writes the scores that are still valid, one category per host. Must be
+// called with mirror_scores_mutex held.
+void
+save_mirror_scores()
+{
+  if (mirror_scores_path.empty())
+    return;
+
+  std::string tmp = mirror_scores_path + ".tmp";
+  std::ofstream out(tmp);
+  out.precision(15);
+  for (const auto& score : mirror_scores)
+  {
+    if (std::time(nullptr) - std::get<1>(score.second) >= MIRROR_RANK_TTL)
+      continue;
+
+    out << "\n# " << score.first << "\nscore: " << std::get<0>(score.second)
+        << "\ntime: " << std::get<1>(score.second) << "\n";
+  }
+
+  out.close();
+  if (out.fail() || rename(tmp.c_str(), mirror_scores_path.c_str()))
+  {
+    log_warn << "Could not save mirror scores to '" << mirror_scores_path << "'" << std::endl;
+    remove(tmp.c_str());
   }
+}
+
+// Ranks the mirror last until it is probed again.
+void
+mirror_failed(const std::string& url)
+{
+  std::lock_guard<std::mutex> lock(mirror_scores_mutex);
+  mirror_scores[mirror_host(url)] = std::make_tuple(HUGE_VAL, std::time(nullptr));
+  save_mirror_scores();
+}
+
+// Sorts the mirrors from fastest to slowest. Mirrors which weren't probed
+// recently are probed concurrently by connecting and reading the first bytes
+// of the file; unreachable mirrors are kept at the end as a last resort.
+std::vector<std::string>
+rank_mirrors(const std::vector<std::string>& mirrors)
+{
+  if (mirrors.size() < 2)
+    return mirrors;
+
+  std::vector<double> scores(mirrors.size(), -1.0);
+  {
+    std::lock_guard<std::mutex> lock(mirror_scores_mutex);
+    for (size_t i = 0; i < mirrors.size(); i++)
+    {
+      auto it = mirror_scores.find(mirror_host(mirrors[i]));
+      if (it != mirror_scores.end() && std::time(nullptr) - std::get<1>(it->second) < MIRROR_RANK_TTL)
+        scores[i] = std::get<0>(it->second);
+    }
+  }
+
+  CURLM *multi = curl_multi_init();
+  std::vector<CURL*> probes(mirrors.size(), nullptr);
+  std::vector<size_t> received(mirrors.size(), 0);
+  for (size_t i = 0; multi && i < mirrors.size(); i++)
+  {
+    if (scores[i] >= 0.0 || !(probes[i] = curl_easy_init()))
+      continue;
+
+    curl_easy_setopt(probes[i], CURLOPT_URL, mirrors[i].c_str());
+    curl_easy_setopt(probes[i], CURLOPT_RANGE, MIRROR_PROBE_RANGE);
+    curl_easy_setopt(probes[i], CURLOPT_TIMEOUT_MS, MIRROR_PROBE_TIMEOUT);
+    curl_easy_setopt(probes[i], CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt(probes[i], CURLOPT_FAILONERROR, 1);
+    curl_easy_setopt(probes[i], CURLOPT_WRITEFUNCTION, probe_write);
+    curl_easy_setopt(probes[i], CURLOPT_WRITEDATA, &received[i]);
+    // FIXME: That's a security issue
+    curl_easy_setopt(probes[i], CURLOPT_SSL_VERIFYPEER, false);
+    curl_easy_setopt(probes[i], CURLOPT_SSL_VERIFYHOST, false);
+    curl_multi_add_handle(multi, probes[i]);
+  }
+
+  int running = 0;
+  do
+  {
+    if (!multi || curl_multi_perform(multi, &running) != CURLM_OK)
+      break;
+
+    if (running)
+      curl_multi_wait(multi, nullptr, 0, 100, nullptr);
+  }
+  while (running);
+
+  CURLMsg *msg;
+  int left;
+  while (multi && (msg = curl_multi_info_read(multi, &left)))
+  {
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+
+    size_t i = std::find(probes.begin(), probes.end(), msg->easy_handle) - probes.begin();
+    double time = HUGE_VAL;
+    if (msg->data.result == CURLE_OK
+        || (msg->data.result == CURLE_WRITE_ERROR && received[i] > MIRROR_PROBE_SIZE))
+    {
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_TOTAL_TIME, &time);
+      record_metric("mirror_probe_seconds", time, "host", mirror_host(mirrors[i]));
+    }
+    else
+    {
+      count_metric("mirror_probe_failures_total", "host", mirror_host(mirrors[i]));
+    }
+
+    scores[i] = time;
+  }
+  flush_metrics();
+
+  {
+    std::lock_guard<std::mutex> lock(mirror_scores_mutex);
+    for (size_t i = 0; i < mirrors.size(); i++)
+    {
+      if (!probes[i])
+        continue;
+
+      if (scores[i] < 0.0)
+        scores[i] = HUGE_VAL;
+
+      mirror_scores[mirror_host(mirrors[i])] = std::make_tuple(scores[i], std::time(nullptr));
+      curl_multi_remove_handle(multi, probes[i]);
+      curl_easy_cleanup(probes[i]);
+    }
+
+    save_mirror_scores();
+  }
+
+  if (multi)
+    curl_multi_cleanup(multi);
+
+  std::vector<size_t> order;
+  for (size_t i = 0; i < mirrors.size(); i++)
+  {
+    order.push_back(i);
+  }
+
+  std::stable_sort(order.begin(), order.end(), [&scores](size_t a, size_t b) {
+    return scores[a] < scores[b];
+  });
+
+  std::vector<std::string> ranked;
+  for (auto i : order)
+  {
+    ranked.push_back(mirrors[i]);
+  }
+
+  return ranked;
+}
+
+void
+record_transfer(CURL *curl, const std::string& url, CURLcode res)
+{
+  if (metrics_jsonl.empty() && metrics_prometheus.empty())
+    return;
+
+  std::string host = mirror_host(url);
+  if (res != CURLE_OK)
+  {
+    count_metric("download_failures_total", "host", host);
+    flush_metrics();
+    return;
+  }
+
+  double speed = 0.0, ttfb = 0.0, total = 0.0;
+  long connects = 0;
+  curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD, &speed);
+  curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &ttfb);
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total);
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+
+  record_metric("download_bytes_per_second", speed, "host", host);
+  record_metric("download_ttfb_seconds", ttfb, "host", host);
+  record_metric("download_seconds", total, "host", host);
+  // No new connection means an existing one was reused
+  record_metric("download_connection_reused", connects ? 0.0 : 1.0, "host", host);
+  count_metric("downloads_total", "host", host);
+  flush_metrics();
+}
+
+void
+draw_download_screen(Window& w)
+{
+  w.get_renderer().start_draw();
+  auto& t = w.load_texture("../data/images/background.png");
+  w.get_renderer().draw_texture(t, t.get_size(), Rect(0, 0, 640, 400), 0.f, Color(.3f, .3f, .3f), Renderer::Blend::BLEND);
+  w.get_renderer().draw_text("Downloading file... (This might take a while)", Vector(320, 200), Rect(0, 0, 640, 400), Renderer::TextAlign::CENTER, "../data/fonts/Roboto-Regular.ttf", 16, Color(1.f, 1.f, 1.f), Renderer::Blend::BLEND);
+  w.get_renderer().draw_text(std::to_string(floor(double(donwload_size_so_far) / 65536.0) / 16.0) + " Mb / " + std::to_string(floor(donwload_size_total / 65536.0) / 16.0) + " Mb", Vector(320, 230), Rect(0, 0, 640, 400), Renderer::TextAlign::CENTER, "../data/fonts/Roboto-Regular.ttf", 14, Color(1.f, 1.f, 1.f), Renderer::Blend::BLEND);
+  w.get_renderer().end_draw();
+}
+
+size_t
+write_data(void *ptr, size_t size, size_t nmemb, FILE *stream) {
+  size_t written;
+  written = fwrite(ptr, size, nmemb, stream);
+  donwload_size_so_far += written;
+
+  if (window_to_draw_on)
+  {
+    draw_download_screen(*window_to_draw_on);
+  }
+
+  return written;
+}
+
+std::string
+fetch_file(std::string url, const char* path, bool cacheable, bool resume)
+{
+  CURL *curl;
+  FILE *fp;
+  CURLcode res = CURLE_FAILED_INIT;
+  PrefetchPause pause;
+
+  auto mirrors = split_mirrors(url);
+  if (mirrors.empty())
+    return "No URL given";
+
+  const std::string sha256 = artifact_sha256(url);
+  if (cacheable && cache_fetch(sha256, path))
+    return "";
+
+  mirrors = rank_mirrors(mirrors);
+
+  donwload_size_so_far = 0;
+  donwload_size_total = 0;
+
+  // The same handle serves the size check and every download attempt, so
+  // that curl can keep the connection to the mirror alive between them.
+  curl = curl_easy_init();
+  if (!curl)
+    return curl_easy_strerror(res);
+
+  curl_easy_setopt(curl, CURLOPT_URL, mirrors.front().c_str());
+  curl_easy_setopt(curl, CURLOPT_HEADER, 1);
+  curl_easy_setopt(curl, CURLOPT_NOBODY, 1);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, dont_write);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, nullptr);
+  // FIXME: That's a security issue
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, false);
+  res = curl_easy_perform(curl);
+
+  if(!res) {
+    /* check the size */
+    double cl;
+    res = curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &cl);
+    if(!res) {
+      donwload_size_total = cl;
+    }
+  }
+
+  fp = fopen(path, resume ? "ab" : "wb");
+  if (!fp)
+  {
+    curl_easy_cleanup(curl);
+    return "Could not open file for writing";
+  }
+
+  if (resume)
+  {
+    fseek(fp, 0, SEEK_END);
+    donwload_size_so_far = ftell(fp);
+  }
+
+  // On failure or stall, the next mirror picks up where the previous one
+  // stopped, keeping what was already downloaded.
+  for (size_t i = 0; i < mirrors.size(); i++)
+  {
+    // Resetting the options keeps the open connections
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, mirrors[i].c_str());
+    // FIXME: That's a security issue
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, false);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1);
+    curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t) donwload_size_so_far);
+    if (i + 1 < mirrors.size())
+    {
+      curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, MIRROR_STALL_SPEED);
+      curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, MIRROR_STALL_TIME);
+    }
+    res = curl_easy_perform(curl);
+    record_transfer(curl, mirrors[i], res);
+
+    if (res == CURLE_OK)
+      break;
+
+    // This mirror can't resume; retry it from the start
+    if (res == CURLE_RANGE_ERROR && donwload_size_so_far > 0)
+    {
+      fp = freopen(path, "wb", fp);
+      if (!fp)
+      {
+        curl_easy_cleanup(curl);
+        return "Could not open file for writing";
+      }
+
+      donwload_size_so_far = 0;
+      i--;
+      continue;
+    }
+
+    log_warn << "Could not download '" << mirrors[i] << "': "
+             << curl_easy_strerror(res) << std::endl;
+    mirror_failed(mirrors[i]);
+  }
+
+  curl_easy_cleanup(curl);
+  fclose(fp);
+
+  if (res == CURLE_OK && !sha256.empty() && sha256_file(path) != sha256)
+  {
+    remove(path);
+    return "The downloaded file does not match its checksum";
+  }
+
+  if (cacheable && res == CURLE_OK)
+  {
+    cache_store(sha256, path);
+  }
+
+  return (res == CURLE_OK) ? "" : curl_easy_strerror(res);
+}
+
+// TODO: The obvious
+std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>>
+get_installs(const char* path)
+{
+  std::string line;
+  std::ifstream myfile;
+  myfile.open(path);
+
+  if(!myfile.is_open()) {
+    return {{"Custom", {}}};
+  }
+
+  std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>> r;
+  while(std::getline(myfile, line)) {
+    if (line.size() < 3)
+      continue;
+
+    if (line.at(0) == '#')
+    {
+      if (line.at(1) != ' ')
+        continue;
+
+      r.push_back({line.substr(2), {}});
+    }
+    else
+    {
+      if (line.find(": ") == std::string::npos || line.size() < line.find(": ") + 3 || line.find(": ") == 0 || line.find(":") < line.find(": "))
+        continue;
+
+      if (r.size() < 1)
+        continue;
+
+      auto l = std::make_tuple<std::string, std::string>(line.substr(0, line.find(':')), line.substr(line.find(':') + 2));
+      std::get<1>(r.back()).push_back(l);
+    }
+  }
+
+  if (r.empty() || std::get<0>(r.back()) != "Custom")
+  {
+    r.push_back({"Custom", {}});
+  }
+
+  return std::move(r);
+}
+
+void
+save(std::string path, const std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>>& installs)
+{
+  std::ofstream out(path);
+
+  out << "Text above the first category (line starting with #) will be ignored."
+         " Text that\nis not properly formatted will also be safely ignored.\n"
+         "\nFormat for categories: Pound + space + name\nExample:              "
+         " # My Category Name\n\nFormat for versions:   label + colon + space +"
+         " path (label may not have colons)\nExample:               v0.0.0: "
+         "https://example.org/download/version-0-0-0.zip\n\nGiven that the "
+         "first non-empty line below starts with a pound+space pair, any\nline "
+         "that contains colons will be interpreted as a valid version. Be "
+         "careful\nif you write comments below them!\n\n";
+
+  for (const auto& category : installs)
+  {
+    out << "\n# " << std::get<0>(category) << "\n";
+    for (const auto& version : std::get<1>(category))
+    {
+      out << std::get<0>(version) << ": " << std::get<1>(version) << "\n";
+    }
+  }
+
+  out << std::endl; // Both a newline and a flush
+  out.close();
+}
+
+// Settings use the same format as the installs file, with the category being
+// the section and the label being the key.
+std::string
+get_setting(const std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>>& settings,
+            const std::string& category, const std::string& key,
+            const std::string& fallback)
+{
+  for (const auto& c : settings)
+  {
+    if (std::get<0>(c) != category)
+      continue;
+
+    for (const auto& setting : std::get<1>(c))
+    {
+      if (std::get<0>(setting) == key)
+        return std::get<1>(setting);
+    }
+  }
+
+  return fallback;
+}
+
+// Returns an empty string if the entry has no URL.
+std::string
+staged_path(const std::string& path, const std::string& label, const std::string& urls)
+{
+  auto mirrors = split_mirrors(urls);
+  if (mirrors.empty())
+    return "";
+
+  return path + "/staging/" + label + "/" + mirrors.front().substr(mirrors.front().find_last_of('/'));
+}
+
+struct PrefetchJob
+{
+  std::string path;
+  std::string versions_url;
+  std::string category;
+  curl_off_t max_speed;
+};
+
+static PrefetchJob prefetch_job;
+
+bool
+prefetch_idle()
+{
+  return !SDL_AtomicGet(&prefetch_quit) && !SDL_AtomicGet(&prefetch_paused);
+}
+
+// Waits for the prefetch to let go of the staging folder. The prefetch must be
+// paused first, so that it doesn't pick it up again.
+void
+prefetch_wait_stopped()
+{
+  while (SDL_AtomicGet(&prefetch_busy))
+    SDL_Delay(10);
+}
+
+// Sleeps for at least the given time, then until the launcher is idle.
+// Returns false if the launcher is quitting.
+bool
+prefetch_wait(Uint32 ms)
+{
+  Uint32 start = SDL_GetTicks();
+  while (SDL_GetTicks() - start < ms || !prefetch_idle())
+  {
+    if (SDL_AtomicGet(&prefetch_quit))
+      return false;
+
+    SDL_Delay(100);
+  }
+
+  return true;
+}
+
+size_t
+write_quiet(void *ptr, size_t size, size_t nmemb, FILE *stream) {
+  return fwrite(ptr, size, nmemb, stream);
+}
+
+int
+prefetch_progress(void*, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+{
+  // Aborting leaves the partial file in place; the next attempt resumes it.
+  return prefetch_idle() ? 0 : 1;
+}
+
+// Downloads into "path.part", resuming whatever is already there, and only
+// moves the file to its final name once it is complete.
+bool
+prefetch_file(const std::string& urls, const std::string& path, curl_off_t max_speed)
+{
+  for (const auto& url : rank_mirrors(split_mirrors(urls)))
+  {
+    // Checked after marking the prefetch as busy, so that the foreground
+    // either sees it busy or keeps it from starting.
+    PrefetchBusy busy;
+    if (!prefetch_idle())
+      return false;
+
+    std::string part = path + ".part";
+    FILE *fp = fopen(part.c_str(), "ab");
+    if (!fp)
+      return false;
+
+    fseek(fp, 0, SEEK_END);
+    curl_off_t offset = ftell(fp);
+
+    CURL *curl = curl_easy_init();
+    if (!curl)
+    {
+      fclose(fp);
+      return false;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    // FIXME: That's a security issue
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, false);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_quiet);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+    curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, offset);
+    curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, max_speed);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, prefetch_progress);
+    CURLcode res = curl_easy_perform(curl);
+    long code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_cleanup(curl);
+    fclose(fp);
+
+    if (res == CURLE_OK)
+    {
+      std::string sha256 = artifact_sha256(urls);
+      if (!sha256.empty() && sha256_file(part) != sha256)
+      {
+        log_warn << "Prefetched '" << url << "' does not match its checksum"
+                 << std::endl;
+        remove(part.c_str());
+        return false;
+      }
+
+      return !rename(part.c_str(), path.c_str());
+    }
+
+    // The partial file can't be resumed; start over next time.
+    if (res == CURLE_RANGE_ERROR || code == 416)
+      remove(part.c_str());
+
+    if (res == CURLE_ABORTED_BY_CALLBACK)
+      return false;
+
+    log_warn << "Could not prefetch '" << url << "': "
+             << curl_easy_strerror(res) << std::endl;
+    mirror_failed(url);
+  }
+
+  return false;
+}
+
+// Only the newest version is worth keeping; older ones that were never
+// installed would otherwise pile up in the staging folder.
+void
+remove_stale_staging(const std::string& path, const std::string& label)
+{
+#ifdef UNIX
+  std::string staging = path + "/staging";
+  DIR* dir = opendir(staging.c_str());
+  if (!dir)
+    return;
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)))
+  {
+    std::string name = entry->d_name;
+    std::string folder = staging + "/" + name;
+    struct stat st;
+    if (name == "." || name == ".." || name == label
+        || stat(folder.c_str(), &st) || !S_ISDIR(st.st_mode))
+      continue;
+
+    DIR* sub = opendir(folder.c_str());
+    if (sub)
+    {
+      struct dirent* file;
+      while ((file = readdir(sub)))
+      {
+        if (strcmp(file->d_name, ".") && strcmp(file->d_name, ".."))
+          unlink((folder + "/" + file->d_name).c_str());
+      }
+      closedir(sub);
+    }
+
+    if (rmdir(folder.c_str()))
+    {
+      log_warn << "Could not remove staged version '" << folder << "'" << std::endl;
+    }
+    else
+    {
+      log_info << "Removed staged version '" << name << "'" << std::endl;
+    }
+  }
+  closedir(dir);
+#endif
+}
+
+// Waits for the launcher to be idle, then downloads the newest nightly into
+// the staging folder at low priority, so that installing it is instant.
+int
+run_prefetch(void* data)
+{
+  SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+  const auto& job = *static_cast<PrefetchJob*>(data);
+  std::string index = job.path + "/staging/versions.txt";
+  Uint32 delay = PREFETCH_DELAY;
+
+  while (prefetch_wait(delay))
+  {
+    delay = PREFETCH_RETRY_DELAY;
+
+    remove(index.c_str());
+    remove((index + ".part").c_str());
+    if (!prefetch_file(job.versions_url, index, job.max_speed))
+      continue;
+
+    // Entries are appended to the index as they are published, so the newest
+    // nightly is the last one of its category.
+    std::string label, url;
+    for (const auto& c : get_installs(index.c_str()))
+    {
+      if (std::get<0>(c) == job.category && !std::get<1>(c).empty())
+      {
+        label = std::get<0>(std::get<1>(c).back());
+        url = std::get<1>(std::get<1>(c).back());
+      }
+    }
 
-  fclose(devnull);
+    if (label.empty() || url.find('/') == std::string::npos)
+      return 0;
 
-  return (curl && (res == CURLE_OK)) ? "" : curl_easy_strerror(res);
-}
+    std::string sha256 = artifact_sha256(url);
 
-static size_t donwload_size_so_far = 0;
-static double donwload_size_total = 0;
-static Window* window_to_draw_on = nullptr;
+    remove_stale_staging(job.path, label);
 
-size_t
-dont_write(void*, size_t size, size_t nmemb, void*) {
-  return size * nmemb;
-}
+    std::string staged = staged_path(job.path, label, url);
+    if (staged.empty() || std::ifstream(staged).good())
+      return 0;
 
-size_t
-write_data(void *ptr, size_t size, size_t nmemb, FILE *stream) {
-  size_t written;
-  written = fwrite(ptr, size, nmemb, stream);
-  donwload_size_so_far += written;
+    create_dir((job.path + "/staging/" + label).c_str());
+    // Like downloads, copies go through the partial file so that the Download
+    // button never picks up a half-copied file.
+    std::string part = staged + ".part";
+    if (cache_fetch(sha256, part, prefetch_idle))
+    {
+      if (!rename(part.c_str(), staged.c_str()))
+        return 0;
+    }
+    else if (!prefetch_idle())
+    {
+      // Paused during the copy; try again as soon as the launcher is idle
+      delay = 0;
+      continue;
+    }
 
-  if (window_to_draw_on)
-  {
-    auto& w = *window_to_draw_on;
-    w.get_renderer().start_draw();
-    auto& t = w.load_texture("../data/images/background.png");
-    w.get_renderer().draw_texture(t, t.get_size(), Rect(0, 0, 640, 400), 0.f, Color(.3f, .3f, .3f), Renderer::Blend::BLEND);
-    w.get_renderer().draw_text("Downloading file... (This might take a while)", Vector(320, 200), Rect(0, 0, 640, 400), Renderer::TextAlign::CENTER, "../data/fonts/Roboto-Regular.ttf", 16, Color(1.f, 1.f, 1.f), Renderer::Blend::BLEND);
-    w.get_renderer().draw_text(std::to_string(floor(double(donwload_size_so_far) / 65536.0) / 16.0) + " Mb / " + std::to_string(floor(donwload_size_total / 65536.0) / 16.0) + " Mb", Vector(320, 230), Rect(0, 0, 640, 400), Renderer::TextAlign::CENTER, "../data/fonts/Roboto-Regular.ttf", 14, Color(1.f, 1.f, 1.f), Renderer::Blend::BLEND);
-    w.get_renderer().end_draw();
+    if (prefetch_file(url, staged, job.max_speed))
+    {
+      log_info << "Prefetched '" << label << "' into '" << staged << "'"
+               << std::endl;
+      cache_store(sha256, staged);
+      return 0;
+    }
   }
 
-  return written;
+  return 0;
 }
 
-std::string
-fetch_file(std::string url, const char* path)
+void
+init_cache(const std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>>& settings)
 {
-  CURL *curl;
-  FILE *fp;
-  CURLcode res;
+#ifdef UNIX
+  cache_path = get_setting(settings, "Cache", "path", "");
+  cache_max_size = strtoll(get_setting(settings, "Cache", "max_size",
+                                       std::to_string(CACHE_MAX_SIZE)).c_str(),
+                           nullptr, 10);
 
-  donwload_size_so_far = 0;
-  donwload_size_total = 0;
+  // Shared between users: group-writable, with new files inheriting the group.
+  // The mode is set separately, as mkdir() applies the umask.
+  if (cache_path.empty())
+    return;
 
-  curl = curl_easy_init();
-  if(curl) {
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_HEADER, 1);
-    curl_easy_setopt(curl, CURLOPT_NOBODY, 1);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, dont_write);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, nullptr);
-    // FIXME: That's a security issue
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, false);
-    res = curl_easy_perform(curl);
-  
-    if(!res) {
-      /* check the size */
-      double cl;
-      res = curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &cl);
-      if(!res) {
-        donwload_size_total = cl;
-      }
-    }
+  if (!mkdir(cache_path.c_str(), 0700))
+  {
+    chmod(cache_path.c_str(), 02775);
   }
-
-  curl = curl_easy_init();
-  if (curl) {
-    fp = fopen(path, "wb");
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    // FIXME: That's a security issue
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, false);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
-    res = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
-    fclose(fp);
+  else if (errno != EEXIST)
+  {
+    log_warn << "Could not create cache folder '" << cache_path << "': "
+             << strerror(errno) << std::endl;
+    cache_path.clear();
   }
-
-  return (curl && (res == CURLE_OK)) ? "" : curl_easy_strerror(res);
+#endif
 }
 
-// TODO: The obvious
-std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>>
-get_installs(const char* path)
+// Loads the mirror scores saved by the previous runs
+void
+init_mirror_scores(const std::string& path)
 {
-  std::string line;
-  std::ifstream myfile;
-  myfile.open(path);
+  mirror_scores_path = path + "/mirrors.txt";
 
-  if(!myfile.is_open()) {
-    return {{"Custom", {}}};
+  auto hosts = get_installs(mirror_scores_path.c_str());
+  std::lock_guard<std::mutex> lock(mirror_scores_mutex);
+  for (const auto& host : hosts)
+  {
+    std::string score = get_setting(hosts, std::get<0>(host), "score", "");
+    std::string time = get_setting(hosts, std::get<0>(host), "time", "");
+    if (score.empty() || time.empty())
+      continue;
+
+    mirror_scores[std::get<0>(host)] = std::make_tuple(strtod(score.c_str(), nullptr),
+                                                       (std::time_t) strtoll(time.c_str(), nullptr, 10));
+  }
+}
+
+void
+init_metrics(const std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>>& settings)
+{
+  metrics_jsonl = get_setting(settings, "Metrics", "jsonl", "");
+  metrics_prometheus = get_setting(settings, "Metrics", "prometheus", "");
+  metrics_max_size = strtoll(get_setting(settings, "Metrics", "max_size",
+                                         std::to_string(METRICS_MAX_SIZE)).c_str(),
+                             nullptr, 10);
+
+  std::istringstream disabled(get_setting(settings, "Metrics", "disabled", ""));
+  std::string name;
+  while (disabled >> name)
+  {
+    metrics_disabled.push_back(name);
   }
 
-  std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>> r;
-  while(std::getline(myfile, line)) {
-    if (line.size() < 3)
+  // Counters carry over from the previous runs
+  std::ifstream in(metrics_prometheus);
+  std::string line, type;
+  while (!metrics_prometheus.empty() && std::getline(in, line))
+  {
+    if (line.empty() || line.find_last_of(' ') == std::string::npos)
       continue;
 
     if (line.at(0) == '#')
     {
-      if (line.at(1) != ' ')
-        continue;
-
-      r.push_back({line.substr(2), {}});
+      type = line.substr(line.find_last_of(' ') + 1);
+      continue;
     }
-    else
-    {
-      if (line.find(": ") == std::string::npos || line.size() < line.find(": ") + 3 || line.find(": ") == 0 || line.find(":") < line.find(": "))
-        continue;
-
-      if (r.size() < 1)
-        continue;
 
-      auto l = std::make_tuple<std::string, std::string>(line.substr(0, line.find(':')), line.substr(line.find(':') + 2));
-      std::get<1>(r.back()).push_back(l);
-    }
+    metrics_series[line.substr(0, line.find_last_of(' '))] =
+      std::make_tuple(strtod(line.substr(line.find_last_of(' ') + 1).c_str(), nullptr),
+                      type == "counter");
   }
+}
 
-  if (r.empty() || std::get<0>(r.back()) != "Custom")
+void
+start_prefetch(const std::string& path, const std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>>& settings)
+{
+  if (get_setting(settings, "Prefetch", "enabled", "no") != "yes")
+    return;
+
+  prefetch_job.path = path;
+  prefetch_job.versions_url = get_setting(settings, "Mirrors", "versions", VERSIONS_URL);
+  prefetch_job.category = get_setting(settings, "Prefetch", "category", "Nightlies");
+  prefetch_job.max_speed = strtoll(get_setting(settings, "Prefetch", "max_speed",
+                                               std::to_string(PREFETCH_MAX_SPEED)).c_str(),
+                                   nullptr, 10);
+
+  create_dir((path + "/staging/").c_str());
+  SDL_AtomicSet(&prefetch_quit, 0);
+  prefetch_thread = SDL_CreateThread(run_prefetch, "prefetch", &prefetch_job);
+  if (!prefetch_thread)
   {
-    r.push_back({"Custom", {}});
+    log_warn << "Could not start prefetch: " << SDL_GetError() << std::endl;
   }
-
-  return std::move(r);
 }
 
 void
-save(std::string path, const std::vector<std::tuple<std::string, std::vector<std::tuple<std::string, std::string>>>>& installs)
+stop_prefetch()
 {
-  std::ofstream out(path);
+  if (!prefetch_thread)
+    return;
 
-  out << "Text above the first category (line starting with #) will be ignored."
-         " Text that\nis not properly formatted will also be safely ignored.\n"
-         "\nFormat for categories: Pound + space + name\nExample:              "
-         " # My Category Name\n\nFormat for versions:   label + colon + space +"
-         " path (label may not have colons)\nExample:               v0.0.0: "
-         "https://example.org/download/version-0-0-0.zip\n\nGiven that the "
-         "first non-empty line below starts with a pound+space pair, any\nline "
-         "that contains colons will be interpreted as a valid version. Be "
-         "careful\nif you write comments below them!\n\n";
+  SDL_AtomicSet(&prefetch_quit, 1);
+  SDL_WaitThread(prefetch_thread, nullptr);
+  prefetch_thread = nullptr;
+}
 
-  for (const auto& category : installs)
+// Runs the game, appending what it prints to the log file. `first_output` is
+// set to the time of its first line of output, the earliest sign of the game
+// being up that can be seen from here, or to 0 if it printed nothing. Returns
+// the status of the game, like system() does.
+int
+run_game(const std::string& command, const std::string& log_path, Uint32& first_output)
+{
+  first_output = 0;
+
+#ifdef _WIN32
+  FILE* out = _popen((command + " 2>&1").c_str(), "r");
+#else
+  FILE* out = popen((command + " 2>&1").c_str(), "r");
+#endif
+  if (!out)
   {
-    out << "\n# " << std::get<0>(category) << "\n";
-    for (const auto& version : std::get<1>(category))
-    {
-      out << std::get<0>(version) << ": " << std::get<1>(version) << "\n";
-    }
+    log_warn << "Could not start '" << command << "'" << std::endl;
+    return -1;
   }
 
-  out << std::endl; // Both a newline and a flush
-  out.close();
+  std::ofstream log(log_path, std::ios::app);
+  char line[1024];
+  while (fgets(line, sizeof(line), out))
+  {
+    if (!first_output)
+      first_output = SDL_GetTicks();
+
+    log << line << std::flush;
+  }
+
+#ifdef _WIN32
+  return _pclose(out);
+#else
+  return pclose(out);
+#endif
+}
+
+void
+make_themes(Control::ThemeSet& t, Control::ThemeSet& t2, Control::ThemeSet& t3)
+{
+  memset(&t, 0, sizeof(t));
+  t.active.font = "../data/fonts/Roboto-Regular.ttf";
+  t.active.fontsize = 18;
+  t.active.fg_blend = Renderer::Blend::BLEND;
+  t.active.bg_blend = Renderer::Blend::BLEND;
+  t.active.fg_color = Color(0.f, 0.f, 0.f);
+  t.active.top.padding = 3.f;
+  t.active.left.padding = 3.f;
+  t.active.right.padding = 3.f;
+  t.active.bottom.padding = 3.f;
+  t.disabled = t.active;
+  t.focus = t.active;
+  t.hover = t.active;
+  t.normal = t.active;
+  t.active.bg_color = Color(1.f, 1.f, 1.f);
+  t.disabled.bg_color = Color(.7f, .7f, .75f);
+  t.focus.bg_color = Color(.85f, .85f, .9f);
+  t.hover.bg_color = Color(.9f, .9f, .95f);
+  t.normal.bg_color = Color(.75f, .75f, .8f);
+  t2 = t;
+  t2.active.bg_color = Color(0.f, 0.f, 0.f);
+  t2.disabled.bg_color = Color(0.f, 0.f, 0.f);
+  t2.focus.bg_color = Color(0.f, 0.f, 0.f);
+  t2.hover.bg_color = Color(0.f, 0.f, 0.f);
+  t2.normal.bg_color = Color(0.f, 0.f, 0.f);
+  t2.active.fg_color = Color(1.f, 1.f, 1.f);
+  t2.disabled.fg_color = Color(.7f, .7f, .75f);
+  t2.focus.fg_color = Color(.85f, .85f, .9f);
+  t2.hover.fg_color = Color(.9f, .9f, .95f);
+  t2.normal.fg_color = Color(.8f, .8f, .85f);
+  t3 = t2;
+  t3.active.bg_color = Color(1.f, 1.f, 1.f, 0.3f);
+  t3.active.fontsize = 14;
+  t3.disabled.bg_color = Color(1.f, 1.f, 1.f, 0.f);
+  t3.disabled.fontsize = 14;
+  t3.focus.bg_color = Color(1.f, 1.f, 1.f, 0.2f);
+  t3.focus.fontsize = 14;
+  t3.hover.bg_color = Color(1.f, 1.f, 1.f, 0.1f);
+  t3.hover.fontsize = 14;
+  t3.normal.bg_color = Color(1.f, 1.f, 1.f, 0.f);
+  t3.normal.fontsize = 14;
+}
+
+Listbox<std::string>&
+add_versions_list(Container& c_mainmenu, const Control::ThemeSet& t, const Control::ThemeSet& t2)
+{
+  return c_mainmenu.add<Listbox<std::string>>(25.f, t2, 10, Rect(120, 80, 520, 260), t);
+}
+
+void
+add_main_menu_buttons(Container& c_always, Container& c_mainmenu, const Control::ThemeSet& t,
+                      const Control::ThemeSet& t3, const MainMenuActions& actions)
+{
+  c_mainmenu.add<ButtonLabel>("Play SuperTux", actions.play, 31, true, 1, Rect(160, 270, 480, 310), t);
+  c_always.add<ButtonLabel>("_", actions.minimize, 1, true, 101, Rect(600, 0, 620, 20), t3);
+  c_always.add<ButtonLabel>("X", actions.quit, 1, true, 101, Rect(620, 0, 640, 20), t3);
+  c_mainmenu.add<ButtonLabel>("Check for new versions", actions.check_versions, 31, true, 1, Rect(160, 320, 480, 360), t);
+  c_mainmenu.add<ButtonImage>("../data/images/plus-solid.png", ButtonImage::Scaling::CONTAIN,
+                              actions.add, 1, true, 1, Rect(120, 50, 140, 70), t);
+  c_mainmenu.add<ButtonImage>("../data/images/minus-solid.png", ButtonImage::Scaling::CONTAIN,
+                              actions.detach, 1, true, 1, Rect(150, 50, 170, 70), t);
+  c_mainmenu.add<ButtonImage>("../data/images/trash-alt-solid.png", ButtonImage::Scaling::CONTAIN,
+                              actions.remove, 1, true, 1, Rect(180, 50, 200, 70), t);
+}
+
+void
+draw_frame(Window& w, Container& c_always, Container& active)
+{
+  DrawingContext dc(w.get_renderer());
+  auto& t = w.load_texture("../data/images/background.png");
+  dc.draw_texture(t, t.get_size(), w.get_size(), 0.f, Color(1.f, 1.f, 1.f), Renderer::Blend::BLEND, -1);
+  dc.draw_filled_rect(Rect(0, 0, 640, 20), Color(.15f, .15f, .15f, .9f), Renderer::Blend::BLEND, 100);
+  dc.draw_filled_rect(Rect(0, 0, 640, 21), Color(.15f, .15f, .15f, .2f), Renderer::Blend::BLEND, 100);
+  dc.draw_filled_rect(Rect(0, 0, 640, 22), Color(.15f, .15f, .15f, .2f), Renderer::Blend::BLEND, 100);
+  dc.draw_filled_rect(Rect(0, 0, 640, 23), Color(.15f, .15f, .15f, .1f), Renderer::Blend::BLEND, 100);
+  dc.draw_filled_rect(Rect(0, 0, 640, 24), Color(.15f, .15f, .15f, .1f), Renderer::Blend::BLEND, 100);
+  dc.draw_text("SuperTux Launcher version 0.0.1", Vector(5, 10), Renderer::TextAlign::MID_LEFT,
+              "../data/fonts/SuperTux-Medium.ttf", 12, Color(1.f, 1.f, 1.f), Renderer::Blend::BLEND, 101);
+  c_always.draw(dc);
+  active.draw(dc);
+  dc.render();
+  dc.clear();
 }
 
+// The benchmarks link against this file and provide their own entry point
+#ifndef STLAUNCHER_NO_MAIN
 int
 main()
 {
+  curl_global_init(CURL_GLOBAL_ALL);
+
   try
   {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS))
@@ -295,6 +1655,14 @@ main()
     create_dir((std::string(path) + "/userdirs/").c_str());
     create_dir((std::string(path) + "/installs/").c_str());
 
+    auto settings = get_installs((std::string(path) + "/settings.txt").c_str());
+    init_cache(settings);
+    init_metrics(settings);
+    init_mirror_scores(path);
+    start_prefetch(path, settings);
+    auto versions_url = get_setting(settings, "Mirrors", "versions", VERSIONS_URL);
+    auto crash_url = get_setting(settings, "Mirrors", "crash", CRASH_URL);
+
     SDLWindow w(Size(640.f, 400.f), true);
     w.set_title("SuperTux Launcher");
     w.set_bordered(false);
@@ -305,48 +1673,8 @@ main()
         return (area->y < 20 && area->x < 600) ? SDL_HITTEST_DRAGGABLE : SDL_HITTEST_NORMAL;
       }, nullptr);
 
-    Control::ThemeSet t;
-    memset(&t, 0, sizeof(t));
-    t.active.font = "../data/fonts/Roboto-Regular.ttf";
-    t.active.fontsize = 18;
-    t.active.fg_blend = Renderer::Blend::BLEND;
-    t.active.bg_blend = Renderer::Blend::BLEND;
-    t.active.fg_color = Color(0.f, 0.f, 0.f);
-    t.active.top.padding = 3.f;
-    t.active.left.padding = 3.f;
-    t.active.right.padding = 3.f;
-    t.active.bottom.padding = 3.f;
-    t.disabled = t.active;
-    t.focus = t.active;
-    t.hover = t.active;
-    t.normal = t.active;
-    t.active.bg_color = Color(1.f, 1.f, 1.f);
-    t.disabled.bg_color = Color(.7f, .7f, .75f);
-    t.focus.bg_color = Color(.85f, .85f, .9f);
-    t.hover.bg_color = Color(.9f, .9f, .95f);
-    t.normal.bg_color = Color(.75f, .75f, .8f);
-    Control::ThemeSet t2 = t;
-    t2.active.bg_color = Color(0.f, 0.f, 0.f);
-    t2.disabled.bg_color = Color(0.f, 0.f, 0.f);
-    t2.focus.bg_color = Color(0.f, 0.f, 0.f);
-    t2.hover.bg_color = Color(0.f, 0.f, 0.f);
-    t2.normal.bg_color = Color(0.f, 0.f, 0.f);
-    t2.active.fg_color = Color(1.f, 1.f, 1.f);
-    t2.disabled.fg_color = Color(.7f, .7f, .75f);
-    t2.focus.fg_color = Color(.85f, .85f, .9f);
-    t2.hover.fg_color = Color(.9f, .9f, .95f);
-    t2.normal.fg_color = Color(.8f, .8f, .85f);
-    Control::ThemeSet t3 = t2;
-    t3.active.bg_color = Color(1.f, 1.f, 1.f, 0.3f);
-    t3.active.fontsize = 14;
-    t3.disabled.bg_color = Color(1.f, 1.f, 1.f, 0.f);
-    t3.disabled.fontsize = 14;
-    t3.focus.bg_color = Color(1.f, 1.f, 1.f, 0.2f);
-    t3.focus.fontsize = 14;
-    t3.hover.bg_color = Color(1.f, 1.f, 1.f, 0.1f);
-    t3.hover.fontsize = 14;
-    t3.normal.bg_color = Color(1.f, 1.f, 1.f, 0.f);
-    t3.normal.fontsize = 14;
+    Control::ThemeSet t, t2, t3;
+    make_themes(t, t2, t3);
 
     bool quit = false;
 
@@ -356,7 +1684,7 @@ main()
     Container c_download(false, 1, Rect(0, 0, 640, 400), t, nullptr);
     Container* active = &c_mainmenu;
 
-    auto& l = c_mainmenu.add<Listbox<std::string>>(25.f, t2, 10, Rect(120, 80, 520, 260), t);
+    auto& l = add_versions_list(c_mainmenu, t, t2);
     auto installs_list = get_installs((std::string(path) + "/installs.txt").c_str());
     for (const auto& c : installs_list)
     {
@@ -375,9 +1703,34 @@ main()
       }
 
       std::string file_url = *l_dnl.get_selected_item();
-      std::string install_path = std::string(path) + "/installs/" + l_dnl.get_selected_label() + "/" + file_url.substr(file_url.find_last_of('/'));
+      auto mirrors = split_mirrors(file_url);
+      if (mirrors.empty())
+      {
+        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", "This version has no download address.", w.get_sdl_window());
+        return;
+      }
+
+      std::string main_url = mirrors.front();
+      std::string install_path = std::string(path) + "/installs/" + l_dnl.get_selected_label() + "/" + main_url.substr(main_url.find_last_of('/'));
       create_dir((std::string(path) + "/installs/" + l_dnl.get_selected_label()).c_str());
-      fetch_file(file_url, install_path.c_str());
+
+      PrefetchPause pause;
+      prefetch_wait_stopped();
+
+      // If the version was prefetched in the background, just move it over;
+      // if it was only partly prefetched, finish that download.
+      std::string staged = staged_path(path, l_dnl.get_selected_label(), file_url);
+      if (rename(staged.c_str(), install_path.c_str()))
+      {
+        bool resume = !rename((staged + ".part").c_str(), install_path.c_str());
+        auto r = fetch_file(file_url, install_path.c_str(), true, resume);
+        if (!r.empty())
+        {
+          log_error << "Could not download '" << main_url << "': " << r << std::endl;
+          SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", ("Could not download this version: " + r).c_str(), w.get_sdl_window());
+          return;
+        }
+      }
 
       std::get<1>(installs_list.back()).push_back(std::make_tuple(l_dnl.get_selected_label(), install_path));
       save(std::string(path) + "/installs.txt", installs_list);
@@ -392,16 +1745,22 @@ main()
       active = &c_mainmenu;
     }, 31, true, 1, Rect(160, 325, 480, 355), t);
 
-    c_mainmenu.add<ButtonLabel>("Play SuperTux", [&w, &quit, &path, &l](int btn){
+    MainMenuActions actions;
+    actions.play = [&w, &quit, &path, &l, &crash_url](int btn){
       if (!l.get_selected_item() || l.get_selected_label().empty())
       {
         SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", "Please select a SuperTux version.", w.get_sdl_window());
         return;
       }
 
+      PrefetchPause pause;
+      std::string label = l.get_selected_label();
+      Uint32 clicked = SDL_GetTicks();
       int iv = system(("\"" + *l.get_selected_item() + "\" --version > \"" + std::string(path) + "/console.log\" 2>&1").c_str());
+      record_metric("version_check_seconds", (SDL_GetTicks() - clicked) / 1000.0, "version", label);
       if (iv)
       {
+        flush_metrics();
         SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", "Could not detect SuperTux version. Is this a SuperTux executable?", w.get_sdl_window());
         return;
       }
@@ -411,7 +1770,17 @@ main()
       std::string userdir(std::string(path) + "/userdirs/" + l.get_selected_label());
       create_dir(userdir.c_str());
 
-      int i = system(("\"" + *l.get_selected_item() + "\" --userdir \"" + userdir + "\" >> \"" + std::string(path) + "/console.log\" 2>&1").c_str());
+      Uint32 started = SDL_GetTicks(), first_output;
+      count_metric("launches_total", "version", label);
+      int i = run_game("\"" + *l.get_selected_item() + "\" --userdir \"" + userdir + "\"", std::string(path) + "/console.log", first_output);
+      if (first_output)
+        record_metric("launch_seconds", (first_output - clicked) / 1000.0, "version", label);
+      record_metric("game_seconds", (SDL_GetTicks() - started) / 1000.0, "version", label);
+      record_metric("exit_code", exit_code(i), "version", label);
+      if (i)
+        count_metric("crashes_total", "version", label);
+      flush_metrics();
+
       if (i)
       {
         const SDL_MessageBoxButtonData msg_btns[] = {
@@ -447,7 +1816,7 @@ main()
 
           case 2:
           {
-            auto m = upload_crash((std::string(path) + "/console.log").c_str());
+            auto m = upload_crash((std::string(path) + "/console.log").c_str(), crash_url);
             if (m.empty())
             {
               SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION,
@@ -481,20 +1850,20 @@ main()
       {
         quit = true;
       }
-    }, 31, true, 1, Rect(160, 270, 480, 310), t);
+    };
 
-    c_always.add<ButtonLabel>("_", [&w](int /* btn */){
+    actions.minimize = [&w](int /* btn */){
       w.set_status(Window::Status::MINIMIZED);
-    }, 1, true, 101, Rect(600, 0, 620, 20), t3);
-    c_always.add<ButtonLabel>("X", [&quit](int /* btn */){
+    };
+    actions.quit = [&quit](int /* btn */){
       quit = true;
-    }, 1, true, 101, Rect(620, 0, 640, 20), t3);
+    };
 
-    c_mainmenu.add<ButtonLabel>("Check for new versions", [&path, &w, &active, &c_download, &l_dnl](int btn){
-      auto r = fetch_file(VERSIONS_URL, (std::string(path) + "/versions.txt").c_str());
+    actions.check_versions = [&path, &w, &active, &c_download, &l_dnl, &versions_url](int btn){
+      auto r = fetch_file(versions_url, (std::string(path) + "/versions.txt").c_str());
       if (!r.empty())
       {
-        log_error << "Could not fetch versions from '" VERSIONS_URL "': " << r << std::endl;
+        log_error << "Could not fetch versions from '" << versions_url << "': " << r << std::endl;
         SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", ("Could not fetch list of versions: " + r).c_str(), w.get_sdl_window());
       }
       else
@@ -510,144 +1879,143 @@ main()
         }
         active = &c_download;
       }
-    }, 31, true, 1, Rect(160, 320, 480, 360), t);
-
-    c_mainmenu.add<ButtonImage>("../data/images/plus-solid.png",
-      ButtonImage::Scaling::CONTAIN, [&active, &c_newversion](int /* btn */){
-        active = &c_newversion;
-      }, 1, true, 1, Rect(120, 50, 140, 70), t);
-
-    c_mainmenu.add<ButtonImage>("../data/images/minus-solid.png",
-      ButtonImage::Scaling::CONTAIN, [&l, &w, &installs_list, &path](int /* btn */){
-        if (!l.get_selected_item() || l.get_selected_label().empty())
-        {
-          SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", "Please select a SuperTux version.", w.get_sdl_window());
-          return;
-        }
-
-        const SDL_MessageBoxButtonData msg_btns[] = {
-          { SDL_MESSAGEBOX_BUTTON_ESCAPEKEY_DEFAULT, 0, "No" },
-          { SDL_MESSAGEBOX_BUTTON_RETURNKEY_DEFAULT, 1, "Yes" },
-        };
+    };
 
-        const SDL_MessageBoxData msg = {
-          SDL_MESSAGEBOX_INFORMATION,
-          w.get_sdl_window(),
-          "Detaching version",
-          "This will remove the version from the list. It will NOT uninstall\n"
-          "the game from this PC.\n\n"
-          "This is intended for versions that aren't managed by the launcher;\n"
-          "if you also want to uninstall that version, please use the trash can\n"
-          "button instead.\n\n"
-          "Do you want to remove this version from the list without uninstalling it?",
-          SDL_arraysize(msg_btns),
-          msg_btns,
-          NULL
-        };
+    actions.add = [&active, &c_newversion](int /* btn */){
+      active = &c_newversion;
+    };
 
-        int resp;
+    actions.detach = [&l, &w, &installs_list, &path](int /* btn */){
+      if (!l.get_selected_item() || l.get_selected_label().empty())
+      {
+        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", "Please select a SuperTux version.", w.get_sdl_window());
+        return;
+      }
 
-        if (SDL_ShowMessageBox(&msg, &resp))
-        {
-          log_error << "Could not show error report dialog" << std::endl;
-          return;
-        }
+      const SDL_MessageBoxButtonData msg_btns[] = {
+        { SDL_MESSAGEBOX_BUTTON_ESCAPEKEY_DEFAULT, 0, "No" },
+        { SDL_MESSAGEBOX_BUTTON_RETURNKEY_DEFAULT, 1, "Yes" },
+      };
+
+      const SDL_MessageBoxData msg = {
+        SDL_MESSAGEBOX_INFORMATION,
+        w.get_sdl_window(),
+        "Detaching version",
+        "This will remove the version from the list. It will NOT uninstall\n"
+        "the game from this PC.\n\n"
+        "This is intended for versions that aren't managed by the launcher;\n"
+        "if you also want to uninstall that version, please use the trash can\n"
+        "button instead.\n\n"
+        "Do you want to remove this version from the list without uninstalling it?",
+        SDL_arraysize(msg_btns),
+        msg_btns,
+        NULL
+      };
+
+      int resp;
+
+      if (SDL_ShowMessageBox(&msg, &resp))
+      {
+        log_error << "Could not show error report dialog" << std::endl;
+        return;
+      }
 
-        switch(resp)
-        {
-          case 1:
-            for (auto& category : installs_list)
+      switch(resp)
+      {
+        case 1:
+          for (auto& category : installs_list)
+          {
+            auto& list = std::get<1>(category);
+            bool erased = false;
+            for (auto it = list.begin(); it != list.end(); it++)
             {
-              auto& list = std::get<1>(category);
-              bool erased = false;
-              for (auto it = list.begin(); it != list.end(); it++)
+              if (std::get<0>(*it) == l.get_selected_label() && std::get<1>(*it) == *l.get_selected_item())
               {
-                if (std::get<0>(*it) == l.get_selected_label() && std::get<1>(*it) == *l.get_selected_item())
-                {
-                  list.erase(it);
-                  erased = true;
-                  break;
-                }
-              }
-              if (erased)
+                list.erase(it);
+                erased = true;
                 break;
+              }
             }
-            
-            l.remove_item(l.get_selected_index());
-            save(std::string(path) + "/installs.txt", installs_list);
-            break;
-
-          default:
-            break;
-        }
-
-      }, 1, true, 1, Rect(150, 50, 170, 70), t);
-
-    c_mainmenu.add<ButtonImage>("../data/images/trash-alt-solid.png",
-      ButtonImage::Scaling::CONTAIN, [&l, &w, &installs_list, &path](int /* btn */){
-        if (!l.get_selected_item() || l.get_selected_label().empty())
-        {
-          SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", "Please select a SuperTux version.", w.get_sdl_window());
-          return;
-        }
+            if (erased)
+              break;
+          }
+          
+          l.remove_item(l.get_selected_index());
+          save(std::string(path) + "/installs.txt", installs_list);
+          break;
 
-        const SDL_MessageBoxButtonData msg_btns[] = {
-          { SDL_MESSAGEBOX_BUTTON_ESCAPEKEY_DEFAULT, 0, "No" },
-          { SDL_MESSAGEBOX_BUTTON_RETURNKEY_DEFAULT, 1, "Yes" },
-        };
+        default:
+          break;
+      }
 
-        const SDL_MessageBoxData msg = {
-          SDL_MESSAGEBOX_INFORMATION,
-          w.get_sdl_window(),
-          "Deleting version",
-          "This will delete all files associated with the given version.\n\n"
-          "ALL PROGRESS, LEVELS AND SAVE DATA ASSOCIATED WITH THIS VERSION WILL\n"
-          "BE DELETED AS WELL. If the game has been installed manually, it will\n"
-          "not be uninstalled.\n\n"
-          "Do you want to completely remove this version from your system?",
-          SDL_arraysize(msg_btns),
-          msg_btns,
-          NULL
-        };
+    };
 
-        int resp;
+    actions.remove = [&l, &w, &installs_list, &path](int /* btn */){
+      if (!l.get_selected_item() || l.get_selected_label().empty())
+      {
+        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", "Please select a SuperTux version.", w.get_sdl_window());
+        return;
+      }
 
-        if (SDL_ShowMessageBox(&msg, &resp))
-        {
-          log_error << "Could not show error report dialog" << std::endl;
-          return;
-        }
+      const SDL_MessageBoxButtonData msg_btns[] = {
+        { SDL_MESSAGEBOX_BUTTON_ESCAPEKEY_DEFAULT, 0, "No" },
+        { SDL_MESSAGEBOX_BUTTON_RETURNKEY_DEFAULT, 1, "Yes" },
+      };
+
+      const SDL_MessageBoxData msg = {
+        SDL_MESSAGEBOX_INFORMATION,
+        w.get_sdl_window(),
+        "Deleting version",
+        "This will delete all files associated with the given version.\n\n"
+        "ALL PROGRESS, LEVELS AND SAVE DATA ASSOCIATED WITH THIS VERSION WILL\n"
+        "BE DELETED AS WELL. If the game has been installed manually, it will\n"
+        "not be uninstalled.\n\n"
+        "Do you want to completely remove this version from your system?",
+        SDL_arraysize(msg_btns),
+        msg_btns,
+        NULL
+      };
+
+      int resp;
+
+      if (SDL_ShowMessageBox(&msg, &resp))
+      {
+        log_error << "Could not show error report dialog" << std::endl;
+        return;
+      }
 
-        switch(resp)
-        {
-          case 1:
-            system(("rm -r \"" + std::string(path) + "/installs/" + l.get_selected_label() + "\" \"" + std::string(path) + "/userdirs/" + l.get_selected_label() + "\"").c_str());
+      switch(resp)
+      {
+        case 1:
+          system(("rm -r \"" + std::string(path) + "/installs/" + l.get_selected_label() + "\" \"" + std::string(path) + "/userdirs/" + l.get_selected_label() + "\"").c_str());
 
-            for (auto& category : installs_list)
+          for (auto& category : installs_list)
+          {
+            auto& list = std::get<1>(category);
+            bool erased = false;
+            for (auto it = list.begin(); it != list.end(); it++)
             {
-              auto& list = std::get<1>(category);
-              bool erased = false;
-              for (auto it = list.begin(); it != list.end(); it++)
+              if (std::get<0>(*it) == l.get_selected_label() && std::get<1>(*it) == *l.get_selected_item())
               {
-                if (std::get<0>(*it) == l.get_selected_label() && std::get<1>(*it) == *l.get_selected_item())
-                {
-                  list.erase(it);
-                  erased = true;
-                  break;
-                }
-              }
-              if (erased)
+                list.erase(it);
+                erased = true;
                 break;
+              }
             }
+            if (erased)
+              break;
+          }
 
-            l.remove_item(l.get_selected_index());
-            save(std::string(path) + "/installs.txt", installs_list);
-            break;
+          l.remove_item(l.get_selected_index());
+          save(std::string(path) + "/installs.txt", installs_list);
+          break;
 
-          default:
-            break;
-        }
-      }, 1, true, 1, Rect(180, 50, 200, 70), t);
+        default:
+          break;
+      }
+    };
+
+    add_main_menu_buttons(c_always, c_mainmenu, t, t3, actions);
 
     auto& new_label = c_newversion.add<Textbox>(1, Rect(160, 120, 480, 150), t);
     std::string new_path = "";
@@ -707,20 +2075,7 @@ main()
 
       if (w.get_visible())
       {
-        DrawingContext dc(w.get_renderer());
-        auto& t = w.load_texture("../data/images/background.png");
-        dc.draw_texture(t, t.get_size(), w.get_size(), 0.f, Color(1.f, 1.f, 1.f), Renderer::Blend::BLEND, -1);
-        dc.draw_filled_rect(Rect(0, 0, 640, 20), Color(.15f, .15f, .15f, .9f), Renderer::Blend::BLEND, 100);
-        dc.draw_filled_rect(Rect(0, 0, 640, 21), Color(.15f, .15f, .15f, .2f), Renderer::Blend::BLEND, 100);
-        dc.draw_filled_rect(Rect(0, 0, 640, 22), Color(.15f, .15f, .15f, .2f), Renderer::Blend::BLEND, 100);
-        dc.draw_filled_rect(Rect(0, 0, 640, 23), Color(.15f, .15f, .15f, .1f), Renderer::Blend::BLEND, 100);
-        dc.draw_filled_rect(Rect(0, 0, 640, 24), Color(.15f, .15f, .15f, .1f), Renderer::Blend::BLEND, 100);
-        dc.draw_text("SuperTux Launcher version 0.0.1", Vector(5, 10), Renderer::TextAlign::MID_LEFT,
-                    "../data/fonts/SuperTux-Medium.ttf", 12, Color(1.f, 1.f, 1.f), Renderer::Blend::BLEND, 101);
-        c_always.draw(dc);
-        active->draw(dc);
-        dc.render();
-        dc.clear();
+        draw_frame(w, c_always, *active);
       }
 
       c_always.update(0.015f);
@@ -732,25 +2087,32 @@ main()
   catch (std::exception& e)
   {
     log_fatal << "Unhandled exception: " << e.what() << std::endl;
+    stop_prefetch();
     Font::flush_fonts();
     TTF_Quit();
     IMG_Quit();
     SDL_Quit();
+    curl_global_cleanup();
     return 1;
   }
   catch (...)
   {
     log_fatal << "Unhandled error" << std::endl;
+    stop_prefetch();
     Font::flush_fonts();
     TTF_Quit();
     IMG_Quit();
     SDL_Quit();
+    curl_global_cleanup();
     return 1;
   }
 
+  stop_prefetch();
   Font::flush_fonts();
   TTF_Quit();
   IMG_Quit();
   SDL_Quit();
+  curl_global_cleanup();
   return 0;
 }
+#endif